@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <format>
 #include <stdexcept>
 #include <string_view>
@@ -34,6 +35,9 @@ constexpr std::string GenreToString(Genre g) {
     return genre_str;
 }
 
+// Стабильный номер книги: присваивается BookDatabase при вставке и не меняется при переупорядочивании
+using BookId = std::uint64_t;
+
 struct Book {
 public:
     // string_view для экономии памяти, чтобы ссылаться на оригинальную строку, хранящуюся в другом контейнере
@@ -43,10 +47,12 @@ public:
     int year;
     Genre genre;
     double rating;
-    int read_count;
+    // int64: при миллионах прочтений в секунду int переполнился бы за полчаса
+    std::int64_t read_count;
+    BookId id = 0;
 
     Book() = delete;
-    Book(std::string t, std::string_view a, int y = 0, Genre g = Genre::Unknown, double r = 0.0, int rc = 0)
+    Book(std::string t, std::string_view a, int y = 0, Genre g = Genre::Unknown, double r = 0.0, std::int64_t rc = 0)
         : author(a), title(std::move(t)), year(y), genre(g), rating(r), read_count(rc) {}
 
     Book(std::string t, std::string_view a, std::string g)
@@ -1,14 +1,24 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
 #include <print>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 #include <set>
 
 #include "book.hpp"
 #include "concepts.hpp"
 #include "heterogeneous_lookup.hpp"
+#include "journal.hpp"
+#include "query_cache.hpp"
+#include "read_counter.hpp"
 
 namespace bookdb {
 
@@ -16,10 +26,11 @@ template <BookContainerLike BookContainer = std::vector<Book>>
 class BookDatabase {
 public:
     // Хотел использовать flat_set, но он плохо работает с string_view
-    using AuthorContainer   = std::set<std::string, TransparentStringLess>;
-    using book_iterator     = typename BookContainer::iterator;
-    using author_iterator   = typename AuthorContainer::iterator;
-    using size_type         = typename BookContainer::size_type;
+    using AuthorContainer       = std::set<std::string, TransparentStringLess>;
+    using book_iterator         = typename BookContainer::iterator;
+    using const_book_iterator   = typename BookContainer::const_iterator;
+    using author_iterator       = typename AuthorContainer::iterator;
+    using size_type             = typename BookContainer::size_type;
     BookDatabase() = default;
 
     BookDatabase(std::initializer_list<Book> init) {
@@ -29,12 +40,37 @@ public:
     }
 
     void Clear() {
+        if (journal_) journal_->AppendClear();
         books_.clear();
         authors_.clear();
+        // Новое поколение id: номера выдаются с нуля, а RecordRead со старыми id возвращает false
+        reads_.Reset();
+        row_of_id_.clear();
+        ++generation_;
+        if (journal_) journal_->Commit();
     }
 
-    book_iterator begin() noexcept { return books_.begin(); }
-    book_iterator end() noexcept { return books_.end(); }
+    // Неконстантный доступ может менять книги и их порядок, поэтому сбрасывает кэш запросов
+    // и перестраивает соответствие id -> строка при следующем переносе прочтений.
+    // Сброс происходит в момент выдачи доступа: если изменять книги позже через сохранённые
+    // итераторы или ссылки, после изменений нужно вызвать MarkModified(). Для чтения — cbegin()/cend()
+    book_iterator begin() noexcept {
+        FlushReads();
+        rows_stale_ = true;
+        ++generation_;
+        return books_.begin();
+    }
+    book_iterator end() noexcept {
+        FlushReads();
+        rows_stale_ = true;
+        ++generation_;
+        return books_.end();
+    }
+
+    const_book_iterator begin() const noexcept { return books_.begin(); }
+    const_book_iterator end() const noexcept { return books_.end(); }
+    const_book_iterator cbegin() const noexcept { return books_.begin(); }
+    const_book_iterator cend() const noexcept { return books_.end(); }
 
     author_iterator authors_begin() noexcept { return authors_.begin(); }
     author_iterator authors_end() noexcept { return authors_.end(); }
@@ -43,6 +79,9 @@ public:
     bool empty() const noexcept { return books_.empty(); }
 
     BookContainer& GetBooks() noexcept {
+        FlushReads();
+        rows_stale_ = true;
+        ++generation_;
         return books_;
     }
 
@@ -55,28 +94,234 @@ public:
     }
 
     void PushBack(Book book) {
-        if (!book.author.empty()) {
-            auto [it, inserted] = authors_.emplace(book.author);
-            book.author = *it;
-        }
-        books_.push_back(std::move(book));
+        Insert(std::move(book));
     }
 
     template <typename... Args>
     Book& EmplaceBack(Args&&... args) {
-    Book& b = books_.emplace_back(std::forward<Args>(args)...);
+        return Insert(Book(std::forward<Args>(args)...));
+    }
+
+    // Журнал не принадлежит базе и должен жить, пока подключён.
+    // Копия базы к журналу не подключена; при перемещении журнал переходит к новой базе
+    void AttachJournal(Journal& journal) noexcept { journal_.reset(&journal); }
+    void DetachJournal() noexcept { journal_.reset(); }
+    Journal* GetJournal() const noexcept { return journal_.get(); }
 
-    if (!b.author.empty()) {
-        auto [it, inserted] = authors_.emplace(b.author);
-        b.author = *it;
+    // Обменивает книги, авторов и накопленные прочтения с other; журнал, кэш и политика переноса
+    // остаются у своих баз. Не бросает. Нельзя вызывать параллельно с RecordRead
+    void SwapContents(BookDatabase& other) noexcept {
+        using std::swap;
+        swap(books_, other.books_);
+        swap(authors_, other.authors_);
+        swap(reads_, other.reads_);
+        swap(row_of_id_, other.row_of_id_);
+        swap(rows_stale_, other.rows_stale_);
+        ++generation_;
+        ++other.generation_;
     }
 
-    return b;
-}
+    // Кэш результатов FindRows/TopNRows; выключен по умолчанию
+    void EnableQueryCache(std::size_t capacity = 128) { cache_.emplace(capacity); }
+    void DisableQueryCache() noexcept { cache_.reset(); }
+    bool QueryCacheEnabled() const noexcept { return cache_.has_value(); }
+    QueryCacheStats GetQueryCacheStats() const noexcept { return cache_ ? cache_->GetStats() : QueryCacheStats{}; }
+
+    // Поколение растёт при любом изменении базы и при выдаче неконстантного доступа к книгам.
+    // Перенос прочтений его не трогает: он меняет только read_count и учитывается в GetReadGeneration()
+    std::uint64_t GetGeneration() const noexcept { return generation_; }
+
+    // Растёт при каждом переносе прочтений, изменившем read_count
+    std::uint64_t GetReadGeneration() const noexcept { return read_generation_; }
+
+    // Сообщает базе, что книги изменены через ранее полученные итераторы или ссылки
+    void MarkModified() noexcept { ++generation_; }
+
+    // Константные запросы можно выполнять из нескольких потоков одновременно,
+    // но не параллельно с неконстантными методами (кроме RecordRead)
+
+    // Номера строк книг, удовлетворяющих pred
+    template <BookPredicate Pred>
+    QueryResult FindRows(Pred pred) const {
+        return Cached(pred, [](const auto& q) { return std::format("filter:{}", q.Key()); }, [&] {
+            std::vector<std::size_t> rows;
+            std::size_t i = 0;
+            for (const auto& b : books_) {
+                if (pred(b)) rows.push_back(i);
+                ++i;
+            }
+            return rows;
+        });
+    }
+
+    // Номера строк первых count книг в порядке comp. В отличие от getTopNBy не переставляет книги
+    template <BookComparator Comp>
+    QueryResult TopNRows(std::size_t count, Comp comp) const {
+        return Cached(comp, [count](const auto& q) { return std::format("top:{}:{}", q.Key(), count); }, [&] {
+            std::vector<const Book*> ptrs;
+            for (const auto& b : books_) ptrs.push_back(&b);
+
+            std::vector<std::size_t> rows(ptrs.size());
+            for (std::size_t i = 0; i < rows.size(); ++i) rows[i] = i;
+
+            std::size_t n = std::min(count, rows.size());
+            std::partial_sort(rows.begin(), rows.begin() + n, rows.end(),
+                              [&](std::size_t a, std::size_t b) { return comp(*ptrs[a], *ptrs[b]); });
+            rows.resize(n);
+            return rows;
+        });
+    }
+
+    // Единственный метод, который можно вызывать из любых потоков одновременно с остальными
+    // (кроме копирования, перемещения и SwapContents).
+    // Книга адресуется Book::id, а не номером строки, поэтому сортировка в другом потоке не перепутает книги.
+    // Возвращает false для id, которых база не выдавала или выдала до последнего Clear()
+    bool RecordRead(BookId id, std::uint64_t count = 1) noexcept { return reads_.Record(id, count); }
+
+    std::uint64_t PendingReads() const noexcept { return reads_.PendingReads(); }
+
+    // Переносит накопленные прочтения в read_count (с насыщением). Только из потока-владельца.
+    // Константные запросы, в том числе статистика и TopNRows, видят read_count на момент последнего переноса.
+    // Возвращает число перенесённых прочтений
+    std::uint64_t FlushReads() noexcept {
+        last_fold_ = std::chrono::steady_clock::now();
+        if (reads_.PendingReads() == 0) return 0;
+        if (rows_stale_) RebuildRowIndex();
+
+        std::uint64_t applied = 0;
+        reads_.Drain([&](std::size_t index, std::uint64_t count) noexcept {
+            if (index >= row_of_id_.size()) return;
+            const size_type row = row_of_id_[index];
+            if (row == kNoRow) return;
+
+            auto it = std::ranges::next(std::ranges::begin(books_), static_cast<std::ptrdiff_t>(row));
+            it->read_count = detail::SaturatingAddReads(it->read_count, count);
+            applied += count;
+        });
+        // Остальные запросы от read_count не зависят: их кэш перенос не сбрасывает
+        if (applied) ++read_generation_;
+        return applied;
+    }
+
+    // Периодический перенос по ReadFoldPolicy. Вставки вызывают его сами; владельцу,
+    // у которого вставок мало, стоит вызывать его из своего цикла или таймера
+    void SetReadFoldPolicy(ReadFoldPolicy policy) noexcept { fold_policy_ = policy; }
+
+    bool FlushReadsIfDue() noexcept {
+        const auto pending = reads_.PendingReads();
+        if (pending == 0) return false;
+        if (pending < fold_policy_.max_pending_reads &&
+            std::chrono::steady_clock::now() - last_fold_ < fold_policy_.max_delay)
+            return false;
+        FlushReads();
+        return true;
+    }
 
 private:
+    // Указатель на журнал, который не копируется: две базы писали бы в один файл вперемешку,
+    // и восстановление собрало бы состояние, которого не было ни у одной из них
+    class JournalLink {
+    public:
+        JournalLink() = default;
+        JournalLink(const JournalLink&) noexcept {}
+        JournalLink(JournalLink&& other) noexcept : journal_(std::exchange(other.journal_, nullptr)) {}
+
+        JournalLink& operator=(const JournalLink&) noexcept {
+            journal_ = nullptr;
+            return *this;
+        }
+        JournalLink& operator=(JournalLink&& other) noexcept {
+            journal_ = std::exchange(other.journal_, nullptr);
+            return *this;
+        }
+
+        void reset(Journal* journal = nullptr) noexcept { journal_ = journal; }
+        Journal* get() const noexcept { return journal_; }
+        Journal* operator->() const noexcept { return journal_; }
+        explicit operator bool() const noexcept { return journal_ != nullptr; }
+
+    private:
+        Journal* journal_ = nullptr;
+    };
+
     BookContainer books_;
     AuthorContainer authors_;
+    JournalLink journal_;
+
+    // Кэш — деталь реализации константных запросов, поэтому mutable; синхронизирован внутри
+    mutable std::optional<QueryCache> cache_;
+    std::uint64_t generation_ = 0;
+    std::uint64_t read_generation_ = 0;
+
+    static constexpr size_type kNoRow = static_cast<size_type>(-1);
+
+    ReadCounter reads_;
+    std::vector<size_type> row_of_id_;  // строка книги с ReadCounter::IndexOf(id) == i
+    bool rows_stale_ = false;
+    ReadFoldPolicy fold_policy_;
+    std::chrono::steady_clock::time_point last_fold_ = std::chrono::steady_clock::now();
+
+    // Не выделяет память: размер row_of_id_ не меняется
+    void RebuildRowIndex() noexcept {
+        std::ranges::fill(row_of_id_, kNoRow);
+        size_type row = 0;
+        for (const auto& b : books_) {
+            const std::size_t index = ReadCounter::IndexOf(b.id);
+            if (index < row_of_id_.size()) row_of_id_[index] = row;
+            ++row;
+        }
+        rows_stale_ = false;
+    }
+
+    // Порядок для обоих путей вставки: журнал, затем база, затем подтверждение записи в журнале.
+    // Если база вставку не приняла, запись журнала откатывается, и фантомных книг при восстановлении нет
+    Book& Insert(Book book) {
+        if constexpr (requires { books_.reserve(books_.capacity()); }) {
+            // После reserve вставка в vector уже не бросает
+            if (books_.size() == books_.capacity()) books_.reserve(books_.size() * 2 + 1);
+        }
+        if (row_of_id_.size() == row_of_id_.capacity()) row_of_id_.reserve(row_of_id_.size() * 2 + 1);
+        book.id = reads_.PrepareId();
+        if (!book.author.empty()) {
+            auto [it, inserted] = authors_.emplace(book.author);
+            book.author = *it;
+        }
+
+        if (journal_) journal_->AppendInsert(book);
+        Book* b = nullptr;
+        try {
+            b = &books_.emplace_back(std::move(book));
+        } catch (...) {
+            if (journal_) journal_->Rollback();
+            throw;
+        }
+        reads_.CommitId();
+        row_of_id_.push_back(books_.size() - 1);
+        ++generation_;
+
+        if (journal_) journal_->Commit();
+        FlushReadsIfDue();
+        return *b;
+    }
+
+    // Запросы без канонического ключа (например, произвольные лямбды) вычисляются без кэша.
+    // Ключ запросов, читающих read_count, включает поколение прочтений: после переноса они промахиваются,
+    // а записи с прежним поколением вытесняются по LRU
+    template <typename Query, typename MakeKey, typename Compute>
+    QueryResult Cached(const Query& query, MakeKey make_key, Compute compute) const {
+        if constexpr (CacheKeyed<Query>) {
+            if (cache_) {
+                std::string key = make_key(query);
+                if constexpr (UsesReadCount<Query>) key += std::format("@reads:{}", read_generation_);
+                if (auto hit = cache_->Find(key, generation_)) return hit;
+
+                auto rows = std::make_shared<const std::vector<std::size_t>>(compute());
+                cache_->Insert(std::move(key), generation_, rows);
+                return rows;
+            }
+        }
+        return std::make_shared<const std::vector<std::size_t>>(compute());
+    }
 };
 
 }  // namespace bookdb
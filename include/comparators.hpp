@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 #include "book.hpp"
 
 namespace bookdb::comp {
@@ -8,42 +10,57 @@ struct LessByAuthor {
     bool operator()(const Book &a, const Book &b) const {
         return a.author < b.author;
     }
+
+    static std::string Key() { return "LessByAuthor"; }
 };
 
 struct LessByTitle {
     bool operator()(const Book &a, const Book &b) const {
         return a.title < b.title;
     }
+
+    static std::string Key() { return "LessByTitle"; }
 };
 
 struct LessByYear {
     bool operator()(const Book &a, const Book &b) const {
         return a.year < b.year;
     }
+
+    static std::string Key() { return "LessByYear"; }
 };
 
 struct LessByGenre {
     bool operator()(const Book &a, const Book &b) const {
         return a.genre < b.genre;
     }
+
+    static std::string Key() { return "LessByGenre"; }
 };
 
 struct LessByRating {
     bool operator()(const Book &a, const Book &b) const {
         return a.rating < b.rating;
     }
+
+    static std::string Key() { return "LessByRating"; }
 };
 
 struct MoreByRating {
     bool operator()(const Book &a, const Book &b) const {
         return a.rating > b.rating;
     }
+
+    static std::string Key() { return "MoreByRating"; }
 };
 
 struct LessByPopularity {
     bool operator()(const Book &a, const Book &b) const {
         return a.read_count < b.read_count;
     }
+
+    static constexpr bool kUsesReadCount = true;
+    static std::string Key() { return "LessByPopularity"; }
 };
 
 }  // namespace bookdb::comp
\ No newline at end of file
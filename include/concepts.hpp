@@ -2,6 +2,7 @@
 
 #include <concepts>
 #include <iterator>
+#include <string>
 
 #include "book.hpp"
 
@@ -29,4 +30,17 @@ template <typename C>
 concept BookComparator =
     std::strict_weak_order<C, const Book&, const Book&>;
 
+// Предикат или компаратор с каноническим описанием — такие запросы можно кэшировать
+template <typename Q>
+concept CacheKeyed = requires(const Q& q) {
+    { q.Key() } -> std::convertible_to<std::string>;
+};
+
+// Запрос читает read_count: его кэш устаревает и при переносе прочтений, а не только при изменении книг.
+// Кэшируемые предикаты и компараторы, зависящие от read_count, объявляют kUsesReadCount = true
+template <typename Q>
+concept UsesReadCount = requires {
+    { Q::kUsesReadCount } -> std::convertible_to<bool>;
+} && Q::kUsesReadCount;
+
 }  // namespace bookdb
\ No newline at end of file
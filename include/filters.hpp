@@ -1,43 +1,114 @@
 #pragma once
 
 #include <algorithm>
+#include <format>
 #include <functional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
 
 #include "book.hpp"
 #include "concepts.hpp"
 
 namespace bookdb {
 
-inline auto YearBetween(int from, int to) {
-    return [from, to](const Book& b) {
+// Предикаты — именованные функторы, а не лямбды: Key() даёт каноническое описание для кэша запросов
+
+struct YearBetweenPred {
+    int from;
+    int to;
+
+    bool operator()(const Book& b) const {
         return b.year >= from && b.year <= to;
-    };
+    }
+
+    std::string Key() const { return std::format("YearBetween({},{})", from, to); }
+};
+
+struct RatingAbovePred {
+    double threshold;
+
+    bool operator()(const Book& b) const {
+        return b.rating >= threshold;
+    }
+
+    std::string Key() const { return std::format("RatingAbove({})", threshold); }
+};
+
+struct GenreIsPred {
+    Genre genre;
+
+    bool operator()(const Book& b) const {
+        return b.genre == genre;
+    }
+
+    std::string Key() const { return std::format("GenreIs({})", genre); }
+};
+
+inline auto YearBetween(int from, int to) {
+    return YearBetweenPred{from, to};
 }
 
 inline auto RatingAbove(double threshold) {
-    return [threshold](const Book& b) {
-        return b.rating >= threshold;
-    };
+    return RatingAbovePred{threshold};
 }
 
 inline auto GenreIs(Genre g) {
-    return [g](const Book& b) {
-        return b.genre == g;
-    };
+    return GenreIsPred{g};
 }
 
+namespace detail {
+
+// Ключ комбинатора есть, только если он есть у всех вложенных предикатов
+template <typename... Preds>
+std::string CombinedKey(std::string_view name, const std::tuple<Preds...>& preds) {
+    std::string key{name};
+    key += '(';
+    std::apply([&](const auto&... p) {
+        bool first = true;
+        ((key += first ? "" : ",", key += p.Key(), first = false), ...);
+    }, preds);
+    key += ')';
+    return key;
+}
+
+}  // namespace detail
+
+template <typename... Preds>
+struct AllOfPred {
+    std::tuple<Preds...> preds;
+
+    bool operator()(const Book& b) const {
+        return std::apply([&](const auto&... p) { return (p(b) && ...); }, preds);
+    }
+
+    static constexpr bool kUsesReadCount = (UsesReadCount<Preds> || ...);
+
+    std::string Key() const requires (CacheKeyed<Preds> && ...) { return detail::CombinedKey("all_of", preds); }
+};
+
+template <typename... Preds>
+struct AnyOfPred {
+    std::tuple<Preds...> preds;
+
+    bool operator()(const Book& b) const {
+        return std::apply([&](const auto&... p) { return (p(b) || ...); }, preds);
+    }
+
+    static constexpr bool kUsesReadCount = (UsesReadCount<Preds> || ...);
+
+    std::string Key() const requires (CacheKeyed<Preds> && ...) { return detail::CombinedKey("any_of", preds); }
+};
+
 template <typename... Preds>
 inline auto all_of(Preds... preds) {
-    return [=](const Book& b) {
-        return (preds(b) && ...);
-    };
+    return AllOfPred<Preds...>{{std::move(preds)...}};
 }
 
 template <typename... Preds>
 inline auto any_of(Preds... preds) {
-    return [=](const Book& b) {
-        return (preds(b) || ...);
-    };
+    return AnyOfPred<Preds...>{{std::move(preds)...}};
 }
 
 template <typename It, typename Pred>
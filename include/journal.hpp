@@ -0,0 +1,411 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include "book.hpp"
+
+namespace bookdb {
+
+// Формат записи: [u32 длина payload][u32 контрольная сумма][u8 операция][payload].
+// Числа пишутся в порядке байт хоста: журнал локальный и на другую машину не переносится.
+// Epoch — номер поколения журнала; если он есть, то это первая запись файла (журнала или снапшота).
+enum class JournalOp : std::uint8_t { Insert = 1, Clear = 2, Epoch = 3 };
+
+struct JournalOptions {
+    // Group commit: буфер сбрасывается на диск одним write + fdatasync,
+    // когда накопилось столько байт или с прошлого сброса прошло столько времени.
+    // Порог по времени соблюдает фоновый поток, так что окно потери данных ограничено и в простое
+    std::size_t group_commit_bytes = 64 * 1024;
+    std::chrono::milliseconds group_commit_interval{10};
+};
+
+namespace detail {
+
+inline constexpr std::size_t kJournalHeaderSize = sizeof(std::uint32_t) * 2 + sizeof(JournalOp);
+
+// FNV-1a: дёшево и достаточно, чтобы отличить оборванный хвост от целой записи
+inline std::uint32_t JournalChecksum(std::string_view data) noexcept {
+    std::uint32_t hash = 2166136261u;
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+void PutRaw(std::string &out, T value) {
+    char buf[sizeof(T)];
+    std::memcpy(buf, &value, sizeof(T));
+    out.append(buf, sizeof(T));
+}
+
+inline void PutString(std::string &out, std::string_view s) {
+    PutRaw(out, static_cast<std::uint32_t>(s.size()));
+    out.append(s);
+}
+
+template <typename T>
+bool GetRaw(std::string_view &in, T &value) noexcept {
+    if (in.size() < sizeof(T)) return false;
+    std::memcpy(&value, in.data(), sizeof(T));
+    in.remove_prefix(sizeof(T));
+    return true;
+}
+
+inline bool GetString(std::string_view &in, std::string_view &s) noexcept {
+    std::uint32_t len = 0;
+    if (!GetRaw(in, len) || in.size() < len) return false;
+    s = in.substr(0, len);
+    in.remove_prefix(len);
+    return true;
+}
+
+[[noreturn]] inline void ThrowJournalError(const char *what) {
+    throw std::system_error{errno, std::generic_category(), what};
+}
+
+// Пишет data целиком; при ошибке возвращает false, в written — сколько успело уйти
+inline bool WriteAll(int fd, std::string_view data, std::size_t &written) noexcept {
+    written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+}  // namespace detail
+
+inline void EncodeBook(std::string &out, const Book &b) {
+    detail::PutString(out, b.title);
+    detail::PutString(out, b.author);
+    detail::PutRaw(out, static_cast<std::int32_t>(b.year));
+    detail::PutRaw(out, static_cast<std::uint8_t>(b.genre));
+    detail::PutRaw(out, b.rating);
+    detail::PutRaw(out, static_cast<std::int64_t>(b.read_count));
+}
+
+// author у результата ссылается на payload, поэтому книгу нужно сразу передать в BookDatabase
+inline std::optional<Book> DecodeBook(std::string_view payload) {
+    std::string_view title, author;
+    std::int32_t year = 0;
+    std::int64_t read_count = 0;
+    std::uint8_t genre = 0;
+    double rating = 0.0;
+
+    if (!detail::GetString(payload, title) || !detail::GetString(payload, author) || !detail::GetRaw(payload, year) ||
+        !detail::GetRaw(payload, genre) || !detail::GetRaw(payload, rating) || !detail::GetRaw(payload, read_count))
+        return std::nullopt;
+
+    if (genre > std::to_underlying(Genre::Unknown)) genre = std::to_underlying(Genre::Unknown);
+    return Book{std::string(title), author, year, static_cast<Genre>(genre), rating, read_count};
+}
+
+// Дописывает в out запись с операцией op; encode(out) дописывает payload
+template <typename Encoder>
+void AppendJournalRecord(std::string &out, JournalOp op, Encoder &&encode) {
+    constexpr std::size_t prefix = sizeof(std::uint32_t) * 2;
+    const std::size_t start = out.size();
+    out.append(prefix, '\0');
+    out.push_back(static_cast<char>(op));
+    encode(out);
+
+    std::string_view body{out.data() + start + prefix, out.size() - start - prefix};
+    std::uint32_t len = static_cast<std::uint32_t>(body.size() - sizeof(JournalOp));
+    std::uint32_t checksum = detail::JournalChecksum(body);
+    std::memcpy(out.data() + start, &len, sizeof(len));
+    std::memcpy(out.data() + start + sizeof(len), &checksum, sizeof(checksum));
+}
+
+struct JournalRecordView {
+    JournalOp op;
+    std::string_view payload;
+    std::size_t size;  // вместе с заголовком
+};
+
+// Первая целая запись data или nullopt, если там оборванный хвост
+inline std::optional<JournalRecordView> NextJournalRecord(std::string_view data) noexcept {
+    std::uint32_t len = 0, checksum = 0;
+    if (!detail::GetRaw(data, len) || !detail::GetRaw(data, checksum)) return std::nullopt;
+    if (data.size() < sizeof(JournalOp) + std::size_t{len}) return std::nullopt;
+
+    std::string_view body = data.substr(0, sizeof(JournalOp) + len);
+    if (detail::JournalChecksum(body) != checksum) return std::nullopt;
+    return JournalRecordView{static_cast<JournalOp>(body.front()), body.substr(sizeof(JournalOp)),
+                             detail::kJournalHeaderSize + len};
+}
+
+// Вызывает visit(op, payload, offset) для каждой целой записи.
+// Возвращает длину корректного префикса: всё, что за ним, — оборванный при сбое хвост.
+template <typename Visitor>
+std::size_t ForEachJournalRecord(std::string_view data, Visitor &&visit) {
+    std::size_t valid = 0;
+    while (auto record = NextJournalRecord(data.substr(valid))) {
+        visit(record->op, record->payload, valid);
+        valid += record->size;
+    }
+    return valid;
+}
+
+inline void EncodeEpoch(std::string &out, std::uint64_t epoch) { detail::PutRaw(out, epoch); }
+
+// Поколение файла: payload первой записи Epoch, 0 — если её нет (журнал ещё не проходил Checkpoint)
+inline std::uint64_t JournalEpoch(std::string_view data) noexcept {
+    auto record = NextJournalRecord(data);
+    std::uint64_t epoch = 0;
+    if (record && record->op == JournalOp::Epoch) detail::GetRaw(record->payload, epoch);
+    return epoch;
+}
+
+inline std::string ReadJournalFile(const std::filesystem::path &path) {
+    std::ifstream in{path, std::ios::binary};
+    if (!in) return {};
+    return {std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+}
+
+// Журнал упреждающей записи для BookDatabase.
+// Запись вносится в два шага: Append* кладёт её в буфер, Commit() подтверждает после изменения базы,
+// Rollback() отменяет, если база изменение не приняла. На диск уходят только подтверждённые записи:
+// пачкой (group commit) по порогу размера — в Commit(), по порогу времени — из фонового потока.
+// Sync() сбрасывает буфер принудительно. Append/Commit/Rollback зовутся из одного потока-владельца.
+// После ошибки fdatasync журнал считается испорченным навсегда: Linux может выбросить грязные страницы
+// и сбросить ошибку, так что повторный fdatasync «успешно» подтвердил бы потерянные данные.
+// Каждый следующий Commit/Sync/Reset бросает ту же ошибку; базу нужно восстанавливать заново через Recover.
+class Journal {
+public:
+    explicit Journal(std::filesystem::path path, JournalOptions options = {})
+        : path_(std::move(path)), options_(options), last_sync_(std::chrono::steady_clock::now()) {
+        // Хватает заголовка первой записи, чтобы узнать поколение
+        std::string head(detail::kJournalHeaderSize + sizeof(std::uint64_t), '\0');
+        std::ifstream in{path_, std::ios::binary};
+        in.read(head.data(), static_cast<std::streamsize>(head.size()));
+        head.resize(static_cast<std::size_t>(in.gcount()));
+        epoch_ = JournalEpoch(head);
+
+        fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0) detail::ThrowJournalError("Journal: open failed");
+        buffer_.reserve(options_.group_commit_bytes + 256);
+
+        if (options_.group_commit_interval.count() > 0)
+            flusher_ = std::jthread{[this](std::stop_token stop) { FlushLoop(stop); }};
+    }
+
+    Journal(const Journal &) = delete;
+    Journal &operator=(const Journal &) = delete;
+
+    ~Journal() {
+        if (flusher_.joinable()) {
+            flusher_.request_stop();
+            flusher_.join();
+        }
+        try {
+            std::lock_guard io{io_mutex_};
+            SyncLocked();
+        } catch (...) {
+            // Из деструктора не бросаем: недописанный хвост отбросит восстановление
+        }
+        ::close(fd_);
+    }
+
+    void AppendInsert(const Book &b) {
+        Append(JournalOp::Insert, [&](std::string &out) { EncodeBook(out, b); });
+    }
+
+    void AppendClear() {
+        Append(JournalOp::Clear, [](std::string &) {});
+    }
+
+    // Подтверждает записи, внесённые после прошлого Commit/Rollback.
+    // Исключение отсюда значит, что запись подтверждена, но сброс на диск не удался
+    void Commit() {
+        bool due = false;
+        bool was_dirty = true;
+        {
+            std::lock_guard lock{mutex_};
+            if (failure_) std::rethrow_exception(failure_);
+            committed_ = buffer_.size();
+            was_dirty = std::exchange(dirty_, true);
+            due = committed_ >= options_.group_commit_bytes;
+        }
+        if (due) {
+            Sync();
+        } else if (!was_dirty) {
+            // Фоновый поток спит, пока нечего сбрасывать: будим его на первой записи пачки
+            wake_.notify_one();
+        }
+    }
+
+    void Rollback() noexcept {
+        std::lock_guard lock{mutex_};
+        buffer_.resize(committed_);
+    }
+
+    // Дописывает подтверждённые записи в файл и дожидается fdatasync.
+    // Заодно сообщает об ошибке, случившейся в фоновом сбросе
+    void Sync() {
+        std::lock_guard io{io_mutex_};
+        if (auto error = std::exchange(flusher_error_, nullptr)) std::rethrow_exception(error);
+        SyncLocked();
+    }
+
+    // Начинает новое поколение: обнуляет файл и пишет в него запись Epoch.
+    // Вызывается после того, как снапшот с поколением GetEpoch() + 1 надёжно лёг на диск
+    void Reset() {
+        std::lock_guard io{io_mutex_};
+        std::string header;
+        AppendJournalRecord(header, JournalOp::Epoch, [&](std::string &out) { EncodeEpoch(out, epoch_ + 1); });
+
+        {
+            std::lock_guard lock{mutex_};
+            if (failure_) std::rethrow_exception(failure_);
+            buffer_.clear();
+            committed_ = 0;
+            dirty_ = false;
+        }
+
+        std::size_t written = 0;
+        if (::ftruncate(fd_, 0) != 0) detail::ThrowJournalError("Journal: ftruncate failed");
+        if (!detail::WriteAll(fd_, header, written)) detail::ThrowJournalError("Journal: write failed");
+        if (::fdatasync(fd_) != 0) Fail("Journal: fdatasync failed");
+        ++epoch_;
+
+        std::lock_guard lock{mutex_};
+        last_sync_ = std::chrono::steady_clock::now();
+    }
+
+    const std::filesystem::path &GetPath() const noexcept { return path_; }
+    std::uint64_t GetEpoch() const noexcept { return epoch_; }
+
+    std::size_t PendingBytes() const {
+        std::lock_guard lock{mutex_};
+        return buffer_.size();
+    }
+
+private:
+    // Вызывается под io_mutex_
+    void SyncLocked() {
+        std::string batch;
+        {
+            std::lock_guard lock{mutex_};
+            if (failure_) std::rethrow_exception(failure_);
+            if (!dirty_) return;
+            batch.assign(buffer_, 0, committed_);
+            buffer_.erase(0, committed_);
+            committed_ = 0;
+            dirty_ = false;
+        }
+
+        std::size_t written = 0;
+        if (!detail::WriteAll(fd_, batch, written)) {
+            // Недописанное возвращаем в начало буфера, чтобы не потерять при следующей попытке
+            int err = errno;
+            std::lock_guard lock{mutex_};
+            buffer_.insert(0, batch, written);
+            committed_ += batch.size() - written;
+            dirty_ = true;
+            errno = err;
+            detail::ThrowJournalError("Journal: write failed");
+        }
+        // Повторять fdatasync нельзя: ядро могло уже выбросить эти страницы
+        if (::fdatasync(fd_) != 0) Fail("Journal: fdatasync failed");
+
+        std::lock_guard lock{mutex_};
+        last_sync_ = std::chrono::steady_clock::now();
+    }
+
+    // Переводит журнал в состояние ошибки, из которого он уже не выходит
+    [[noreturn]] void Fail(const char *what) {
+        std::exception_ptr error;
+        try {
+            detail::ThrowJournalError(what);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        std::lock_guard lock{mutex_};
+        failure_ = error;
+        dirty_ = false;
+        std::rethrow_exception(error);
+    }
+
+    // Строгая гарантия: при исключении буфер остаётся прежним
+    template <typename Encoder>
+    void Append(JournalOp op, Encoder &&encode) {
+        std::lock_guard lock{mutex_};
+        const std::size_t before = buffer_.size();
+        try {
+            AppendJournalRecord(buffer_, op, std::forward<Encoder>(encode));
+        } catch (...) {
+            buffer_.resize(before);
+            throw;
+        }
+    }
+
+    void FlushLoop(std::stop_token stop) {
+        std::unique_lock lock{mutex_};
+        // Остаток при остановке дописывает деструктор
+        while (wake_.wait(lock, stop, [this] { return dirty_; }) && !stop.stop_requested()) {
+            // Даём пачке набраться до конца интервала; если её раньше сбросил Sync, снова засыпаем
+            const auto due = last_sync_ + options_.group_commit_interval;
+            if (wake_.wait_until(lock, stop, due, [this] { return !dirty_; })) continue;
+            if (stop.stop_requested()) break;
+            if (std::chrono::steady_clock::now() < last_sync_ + options_.group_commit_interval) continue;
+
+            lock.unlock();
+            {
+                std::lock_guard io{io_mutex_};
+                try {
+                    SyncLocked();
+                } catch (...) {
+                    // Ошибку фонового сброса получит следующий явный Sync
+                    flusher_error_ = std::current_exception();
+                }
+            }
+            lock.lock();
+            // После неудачной записи повторяем не раньше, чем через интервал
+            last_sync_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    std::filesystem::path path_;
+    JournalOptions options_;
+    int fd_ = -1;
+    std::uint64_t epoch_ = 0;
+
+    // mutex_ защищает буфер, io_mutex_ упорядочивает запись в файл: вставки не ждут fdatasync
+    mutable std::mutex mutex_;
+    std::mutex io_mutex_;
+    std::condition_variable_any wake_;
+    std::string buffer_;
+    std::size_t committed_ = 0;
+    bool dirty_ = false;
+    std::chrono::steady_clock::time_point last_sync_;
+    std::exception_ptr flusher_error_;
+    std::exception_ptr failure_;  // ошибка fdatasync, после которой журналу нельзя доверять
+
+    std::jthread flusher_;
+};
+
+}  // namespace bookdb
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace bookdb {
+
+// Результат запроса — номера строк в BookDatabase; shared_ptr, чтобы попадание в кэш не копировало вектор
+using QueryResult = std::shared_ptr<const std::vector<std::size_t>>;
+
+struct QueryCacheStats {
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+};
+
+// LRU-кэш результатов запросов, ограниченный числом записей.
+// Все записи привязаны к поколению базы: как только поколение меняется, кэш целиком считается устаревшим.
+// Потокобезопасен: константные запросы к базе могут идти из нескольких потоков сразу.
+class QueryCache {
+public:
+    explicit QueryCache(std::size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+    // Содержимое кэша — лишь ускорение, поэтому копия получает ту же ёмкость, но пустой кэш
+    QueryCache(const QueryCache &other) : capacity_(other.capacity_) {}
+    QueryCache &operator=(const QueryCache &other) {
+        if (this != &other) {
+            std::scoped_lock lock{mutex_, other.mutex_};
+            ClearLocked();
+            capacity_ = other.capacity_;
+        }
+        return *this;
+    }
+
+    QueryResult Find(std::string_view key, std::uint64_t generation) {
+        std::lock_guard lock{mutex_};
+        Invalidate(generation);
+
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            ++stats_.misses;
+            return nullptr;
+        }
+
+        ++stats_.hits;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return it->second->rows;
+    }
+
+    void Insert(std::string key, std::uint64_t generation, QueryResult rows) {
+        std::lock_guard lock{mutex_};
+        Invalidate(generation);
+
+        if (auto it = index_.find(key); it != index_.end()) {
+            it->second->rows = std::move(rows);
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return;
+        }
+
+        if (lru_.size() >= capacity_) {
+            index_.erase(lru_.back().key);
+            lru_.pop_back();
+        }
+
+        lru_.push_front({std::move(key), std::move(rows)});
+        // Ключ индекса ссылается на строку внутри узла списка: узлы не перемещаются
+        index_.emplace(lru_.front().key, lru_.begin());
+    }
+
+    void Clear() {
+        std::lock_guard lock{mutex_};
+        ClearLocked();
+    }
+
+    std::size_t size() const {
+        std::lock_guard lock{mutex_};
+        return lru_.size();
+    }
+
+    std::size_t capacity() const noexcept { return capacity_; }
+
+    QueryCacheStats GetStats() const {
+        std::lock_guard lock{mutex_};
+        return stats_;
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        QueryResult rows;
+    };
+
+    void ClearLocked() noexcept {
+        index_.clear();
+        lru_.clear();
+    }
+
+    void Invalidate(std::uint64_t generation) noexcept {
+        if (generation == generation_) return;
+        ClearLocked();
+        generation_ = generation;
+    }
+
+    mutable std::mutex mutex_;
+    std::size_t capacity_;
+    std::uint64_t generation_ = 0;
+    std::list<Entry> lru_;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;
+    QueryCacheStats stats_;
+};
+
+}  // namespace bookdb
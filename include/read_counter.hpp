@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "book.hpp"
+
+namespace bookdb {
+
+// Когда BookDatabase::FlushReadsIfDue переносит прочтения в read_count:
+// накопилось max_pending_reads или с прошлого переноса прошло max_delay
+struct ReadFoldPolicy {
+    std::uint64_t max_pending_reads = 4096;
+    std::chrono::milliseconds max_delay{100};
+};
+
+// Счётчик прочтений для горячего пути: Record вызывается из любых потоков без блокировок.
+// Счётчики адресуются стабильным BookId, а не номером строки, поэтому переупорядочивание книг им не мешает.
+// BookId = [поколение Reset(): 32 бита][номер выдачи: 32 бита]. Reset() начинает новое поколение
+// и выдаёт номера заново с нуля, так что пространство id не кончается, а запоздавшие старые id отбрасываются.
+// Книги разбиты на сегменты по kSegmentSize; в каждом сегменте у каждого шарда свой массив атомиков,
+// выровненный по кэш-линии, и битовая маска «грязных» счётчиков, чтобы Drain не просматривал все подряд.
+// Сегменты и их каталог выделяет только владелец (PrepareId), освобождает — Reset(), дождавшись,
+// пока закончатся начатые до него Record. Копирование, перемещение и обмен — только при отсутствии Record
+class ReadCounter {
+public:
+    static constexpr std::size_t kSegmentBits = 10;
+    static constexpr std::size_t kSegmentSize = std::size_t{1} << kSegmentBits;
+    static constexpr std::size_t kMaxSegments = std::size_t{1} << 14;
+    // Сколько книг можно выдать между вызовами Reset()
+    static constexpr std::uint64_t kMaxBooks = std::uint64_t{kSegmentSize} * kMaxSegments;
+    static constexpr std::size_t kIndexBits = 32;
+    // std::hardware_destructive_interference_size в заголовке даёт предупреждение об ABI
+    static constexpr std::size_t kCacheLineSize = 64;
+
+    static std::size_t DefaultShardCount() noexcept {
+        return std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, 16);
+    }
+
+    // Номер выдачи: совпадает с позицией книги среди вставленных после последнего Reset()
+    static constexpr std::size_t IndexOf(BookId id) noexcept {
+        return static_cast<std::size_t>(id & ((BookId{1} << kIndexBits) - 1));
+    }
+
+    // Память выделяется при первой выдаче id, пустой счётчик ничего не занимает
+    explicit ReadCounter(std::size_t shard_count = DefaultShardCount())
+        : shard_count_(std::max<std::size_t>(shard_count, 1)) {}
+
+    // Копия снимает текущие значения и принимает те же id
+    ReadCounter(const ReadCounter &other) : ReadCounter(other.shard_count_) {
+        const std::uint64_t issued = other.issued_.load(std::memory_order_relaxed);
+        epoch_.store(other.epoch_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        if (!other.shards_) return;
+
+        shards_ = std::make_unique<Shard[]>(shard_count_);
+        for (std::size_t s = 0; s < shard_count_; ++s)
+            shards_[s].pending.store(other.shards_[s].pending.load(std::memory_order_relaxed),
+                                     std::memory_order_relaxed);
+        for (std::size_t seg = 0; seg < other.segments_.size(); ++seg) {
+            AddSegment();
+            for (std::size_t s = 0; s < shard_count_; ++s) {
+                const Lane &from = other.segments_[seg][s];
+                Lane &to = segments_[seg][s];
+                for (std::size_t i = 0; i < kSegmentSize; ++i)
+                    to.counts[i].store(from.counts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                for (std::size_t w = 0; w < to.dirty.size(); ++w)
+                    to.dirty[w].store(from.dirty[w].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+        }
+        issued_.store(issued, std::memory_order_release);
+    }
+
+    // Перемещённый счётчик остаётся пустым и снова готов выдавать id
+    ReadCounter(ReadCounter &&other) noexcept : ReadCounter(other.shard_count_) { Swap(other); }
+
+    ReadCounter &operator=(const ReadCounter &other) {
+        if (this != &other) *this = ReadCounter{other};
+        return *this;
+    }
+
+    ReadCounter &operator=(ReadCounter &&other) noexcept {
+        if (this != &other) {
+            ReadCounter moved{std::move(other)};
+            Swap(moved);
+        }
+        return *this;
+    }
+
+    friend void swap(ReadCounter &a, ReadCounter &b) noexcept { a.Swap(b); }
+
+    // Готовит следующий id; Record начнёт его принимать после CommitId(). Только из потока-владельца
+    BookId PrepareId() {
+        const std::uint64_t index = issued_.load(std::memory_order_relaxed);
+        if (index >= kMaxBooks) throw std::length_error{"ReadCounter: too many books"};
+        if (!shards_) shards_ = std::make_unique<Shard[]>(shard_count_);
+        if ((index >> kSegmentBits) >= segments_.size()) AddSegment();
+        return MakeId(epoch_.load(std::memory_order_relaxed), index);
+    }
+
+    void CommitId() noexcept {
+        issued_.store(issued_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Потокобезопасно и без блокировок.
+    // Возвращает false для id, которые ещё не выданы или выданы до последнего Reset()
+    bool Record(BookId id, std::uint64_t count = 1) noexcept {
+        const auto epoch = static_cast<std::uint32_t>(id >> kIndexBits);
+        const std::size_t index = IndexOf(id);
+        // Быстрый отказ; заодно issued_ > 0 гарантирует, что shards_ уже выделен
+        if (count == 0 || epoch != epoch_.load(std::memory_order_acquire) ||
+            index >= issued_.load(std::memory_order_acquire))
+            return false;
+
+        const std::size_t slot = ThreadSlot() % shard_count_;
+        Shard &shard = shards_[slot];
+        // Reset() ждёт, пока обнулится счётчик своего поколения: после этого сегменты можно освобождать.
+        // seq_cst в паре с Reset(): либо мы видим новое поколение, либо Reset видит нас
+        auto &inflight = shard.inflight[epoch & 1];
+        inflight.fetch_add(1, std::memory_order_seq_cst);
+        const bool ok =
+            epoch_.load(std::memory_order_seq_cst) == epoch && index < issued_.load(std::memory_order_acquire);
+        if (ok) {
+            Lane &lane = directory_.load(std::memory_order_acquire)[index >> kSegmentBits][slot];
+            const std::size_t i = index & (kSegmentSize - 1);
+            // pending растёт раньше счётчика, чтобы Drain никогда не вычел больше, чем было добавлено
+            shard.pending.fetch_add(count, std::memory_order_relaxed);
+            if (lane.counts[i].fetch_add(count, std::memory_order_relaxed) == 0)
+                lane.dirty[i / 64].fetch_or(std::uint64_t{1} << (i % 64), std::memory_order_release);
+        }
+        inflight.fetch_sub(1, std::memory_order_release);
+        return ok;
+    }
+
+    // Сколько прочтений ещё не перенесено; дёшево, годится для проверки порога
+    std::uint64_t PendingReads() const noexcept {
+        std::uint64_t total = 0;
+        if (!shards_) return total;
+        for (std::size_t s = 0; s < shard_count_; ++s) total += shards_[s].pending.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // Вызывает apply(IndexOf(id), count) для всего накопленного и обнуляет счётчики. Только из потока-владельца
+    template <typename Apply>
+    void Drain(Apply &&apply) noexcept {
+        for (std::size_t seg = 0; seg < segments_.size(); ++seg) {
+            for (std::size_t s = 0; s < shard_count_; ++s) {
+                Lane &lane = segments_[seg][s];
+                std::uint64_t drained = 0;
+
+                for (std::size_t w = 0; w < lane.dirty.size(); ++w) {
+                    if (lane.dirty[w].load(std::memory_order_relaxed) == 0) continue;
+                    std::uint64_t bits = lane.dirty[w].exchange(0, std::memory_order_acquire);
+                    while (bits) {
+                        const std::size_t i = w * 64 + static_cast<std::size_t>(std::countr_zero(bits));
+                        bits &= bits - 1;
+                        const std::uint64_t count = lane.counts[i].exchange(0, std::memory_order_relaxed);
+                        if (!count) continue;
+                        apply(seg * kSegmentSize + i, count);
+                        drained += count;
+                    }
+                }
+                if (drained) shards_[s].pending.fetch_sub(drained, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Отбрасывает накопленное, освобождает сегменты и начинает новое поколение id. Только из потока-владельца
+    void Reset() noexcept {
+        const std::uint32_t old = epoch_.load(std::memory_order_relaxed);
+        issued_.store(0, std::memory_order_relaxed);
+        epoch_.store(old + 1, std::memory_order_seq_cst);
+        if (!shards_) return;
+
+        // Record, успевшие увидеть старое поколение, держат свой счётчик; новые его уже не трогают
+        for (std::size_t s = 0; s < shard_count_; ++s) {
+            while (shards_[s].inflight[old & 1].load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+            shards_[s].pending.store(0, std::memory_order_relaxed);
+        }
+        directory_.store(nullptr, std::memory_order_relaxed);
+        directories_.clear();
+        directory_capacity_ = 0;
+        segments_.clear();
+    }
+
+private:
+    struct alignas(kCacheLineSize) Lane {
+        std::array<std::atomic<std::uint64_t>, kSegmentSize> counts{};
+        std::array<std::atomic<std::uint64_t>, kSegmentSize / 64> dirty{};
+    };
+
+    struct alignas(kCacheLineSize) Shard {
+        std::atomic<std::uint64_t> pending{0};
+        std::array<std::atomic<std::uint64_t>, 2> inflight{};  // по чётности поколения
+    };
+
+    static constexpr BookId MakeId(std::uint32_t epoch, std::uint64_t index) noexcept {
+        return (BookId{epoch} << kIndexBits) | index;
+    }
+
+    // Потоки получают слоты по кругу, так что до shard_count_ потоков не делят кэш-линий
+    static std::size_t ThreadSlot() noexcept {
+        static std::atomic<std::size_t> next{0};
+        thread_local const std::size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+    }
+
+    // Каталог растёт удвоением. Старые каталоги живут до Reset(): Record может ещё читать из них
+    void AddSegment() {
+        const std::size_t seg = segments_.size();
+        if (seg == directory_capacity_) {
+            const std::size_t capacity = std::min(std::max<std::size_t>(directory_capacity_ * 2, 4), kMaxSegments);
+            auto grown = std::make_unique<Lane *[]>(capacity);
+            if (seg) std::copy_n(directory_.load(std::memory_order_relaxed), seg, grown.get());
+            directories_.reserve(directories_.size() + 1);
+            directories_.push_back(std::move(grown));
+            directory_capacity_ = capacity;
+        }
+        segments_.reserve(seg + 1);
+        auto lanes = std::make_unique<Lane[]>(shard_count_);
+        // Элемент seg никто не читает, пока CommitId не выдаст id из этого сегмента
+        directories_.back()[seg] = lanes.get();
+        segments_.push_back(std::move(lanes));
+        directory_.store(directories_.back().get(), std::memory_order_release);
+    }
+
+    void Swap(ReadCounter &other) noexcept {
+        using std::swap;
+        swap(shard_count_, other.shard_count_);
+        swap(shards_, other.shards_);
+        swap(segments_, other.segments_);
+        swap(directories_, other.directories_);
+        swap(directory_capacity_, other.directory_capacity_);
+        directory_.store(other.directory_.exchange(directory_.load(std::memory_order_relaxed)),
+                         std::memory_order_relaxed);
+        epoch_.store(other.epoch_.exchange(epoch_.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        issued_.store(other.issued_.exchange(issued_.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+    }
+
+    std::size_t shard_count_;
+    std::unique_ptr<Shard[]> shards_;
+    std::vector<std::unique_ptr<Lane[]>> segments_;
+    std::vector<std::unique_ptr<Lane *[]>> directories_;
+    std::size_t directory_capacity_ = 0;
+    std::atomic<Lane *const *> directory_{nullptr};
+
+    // Меняются только владельцем; читаются на каждом Record, поэтому отдельно от изменяемых писателями полей
+    alignas(kCacheLineSize) std::atomic<std::uint32_t> epoch_{0};
+    std::atomic<std::uint64_t> issued_{0};
+};
+
+namespace detail {
+
+// read_count + count без переполнения: при насыщении остаётся максимум int64
+constexpr std::int64_t SaturatingAddReads(std::int64_t current, std::uint64_t count) noexcept {
+    constexpr auto max = std::numeric_limits<std::int64_t>::max();
+    const std::uint64_t room = static_cast<std::uint64_t>(max) - static_cast<std::uint64_t>(current);
+    return count >= room ? max : static_cast<std::int64_t>(static_cast<std::uint64_t>(current) + count);
+}
+
+}  // namespace detail
+
+}  // namespace bookdb
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "book_database.hpp"
+#include "journal.hpp"
+
+namespace bookdb {
+
+struct ReplayResult {
+    std::size_t valid;    // длина корректного префикса, дальше — оборванный хвост
+    std::uint64_t epoch;  // поколение из первой записи Epoch, 0 — если её нет
+};
+
+// Применяет записи журнала или снапшота к базе.
+// Запись с верной контрольной суммой, которую не удалось разобрать, — это порча или чужой формат,
+// а не оборванный хвост: бросаем std::runtime_error и ничего не отрезаем.
+// При исключении в db остаются записи, применённые до ошибки; Recover поэтому применяет их к временной базе
+template <BookContainerLike T>
+ReplayResult ReplayJournal(BookDatabase<T> &db, std::string_view data) {
+    // Восстановление не должно снова попадать в журнал
+    Journal *journal = db.GetJournal();
+    db.DetachJournal();
+
+    auto malformed = [](std::size_t offset) {
+        return std::runtime_error{std::format("ReplayJournal: malformed record at offset {}", offset)};
+    };
+
+    ReplayResult result{0, JournalEpoch(data)};
+    try {
+        result.valid = ForEachJournalRecord(data, [&](JournalOp op, std::string_view payload, std::size_t offset) {
+            switch (op) {
+                case JournalOp::Insert:
+                    if (auto book = DecodeBook(payload)) {
+                        db.PushBack(std::move(*book));
+                        return;
+                    }
+                    throw malformed(offset);
+                case JournalOp::Clear:
+                    db.Clear();
+                    return;
+                case JournalOp::Epoch:
+                    if (offset == 0 && payload.size() == sizeof(std::uint64_t)) return;
+                    throw malformed(offset);
+            }
+            throw malformed(offset);
+        });
+    } catch (...) {
+        if (journal) db.AttachJournal(*journal);
+        throw;
+    }
+
+    if (journal) db.AttachJournal(*journal);
+    return result;
+}
+
+namespace detail {
+
+// Без fsync каталога rename может стать надёжным позже, чем последующие изменения других файлов
+inline void SyncDirectory(const std::filesystem::path &dir) {
+    int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) ThrowJournalError("SyncDirectory: open failed");
+    if (::fsync(fd) != 0) {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        ThrowJournalError("SyncDirectory: fsync failed");
+    }
+    ::close(fd);
+}
+
+// Атомарно заменяет файл: временный файл, fdatasync, rename, fsync каталога
+inline void ReplaceFile(const std::filesystem::path &path, std::string_view data, const char *what) {
+    auto tmp = path;
+    tmp += ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) ThrowJournalError(what);
+
+    auto fail = [fd, what] {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        ThrowJournalError(what);
+    };
+
+    std::size_t written = 0;
+    if (!WriteAll(fd, data, written)) fail();
+    if (::fdatasync(fd) != 0) fail();
+    ::close(fd);
+    std::filesystem::rename(tmp, path);
+    SyncDirectory(path.parent_path());
+}
+
+}  // namespace detail
+
+// Снапшот хранится в том же формате, что и журнал: запись Epoch, затем одна запись Insert на книгу.
+// epoch — поколение журнала, которое начнётся после снапшота (journal.GetEpoch() + 1): Recover считает,
+// что всё из журнала более старого поколения уже учтено. Значения по умолчанию нет намеренно — снапшот
+// с поколением текущего журнала Recover дополнил бы тем же журналом и задвоил книги. Обычно хватает Checkpoint
+template <BookContainerLike T>
+void SaveSnapshot(const BookDatabase<T> &db, const std::filesystem::path &path, std::uint64_t epoch) {
+    std::string data;
+    AppendJournalRecord(data, JournalOp::Epoch, [&](std::string &out) { EncodeEpoch(out, epoch); });
+    for (const auto &b : db.GetBooks())
+        AppendJournalRecord(data, JournalOp::Insert, [&](std::string &out) { EncodeBook(out, b); });
+
+    detail::ReplaceFile(path, data, "SaveSnapshot failed");
+}
+
+// Снапшот + новое поколение журнала: после этого восстановление читает только свежие записи.
+// Сбой между записью снапшота и Reset() безопасен: Recover увидит, что журнал старше снапшота, и пропустит его
+template <BookContainerLike T>
+void Checkpoint(const BookDatabase<T> &db, Journal &journal, const std::filesystem::path &snapshot) {
+    journal.Sync();
+    SaveSnapshot(db, snapshot, journal.GetEpoch() + 1);
+    journal.Reset();
+}
+
+// Восстанавливает базу при старте: снапшот (если есть), затем журнал поверх него.
+// Оборванный при сбое хвост журнала отрезается, чтобы новые записи не легли за мусором.
+// Всё собирается во временной базе и только при успехе заменяет книги db; если Recover бросил, db не изменена.
+// Вызывается до того, как на журнал откроют Journal
+template <BookContainerLike T>
+void Recover(BookDatabase<T> &db, const std::filesystem::path &journal_path,
+             const std::filesystem::path &snapshot_path = {}) {
+    BookDatabase<T> recovered;
+    std::uint64_t snapshot_epoch = 0;
+    if (!snapshot_path.empty() && std::filesystem::exists(snapshot_path)) {
+        std::string snapshot = ReadJournalFile(snapshot_path);
+        snapshot_epoch = ReplayJournal(recovered, snapshot).epoch;
+        // Поколение 0 у журнала, ещё не проходившего Checkpoint: такой снапшот не отделён от журнала
+        if (snapshot_epoch == 0) throw std::runtime_error{"Recover: snapshot has no epoch after the journal's"};
+    }
+
+    std::string log = ReadJournalFile(journal_path);
+    std::uint64_t journal_epoch = JournalEpoch(log);
+
+    if (journal_epoch < snapshot_epoch) {
+        // Снапшот записан, а Reset() не успел: всё содержимое журнала уже в снапшоте
+        std::string header;
+        AppendJournalRecord(header, JournalOp::Epoch, [&](std::string &out) { EncodeEpoch(out, snapshot_epoch); });
+        detail::ReplaceFile(journal_path, header, "Recover: journal reset failed");
+    } else {
+        if (journal_epoch > snapshot_epoch)
+            throw std::runtime_error{std::format(
+                "Recover: journal epoch {} has no matching snapshot (snapshot epoch {})", journal_epoch, snapshot_epoch)};
+
+        std::size_t valid = ReplayJournal(recovered, log).valid;
+        if (valid < log.size()) std::filesystem::resize_file(journal_path, valid);
+    }
+
+    db.SwapContents(recovered);
+}
+
+}  // namespace bookdb
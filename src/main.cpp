@@ -52,7 +52,7 @@ int main() {
     std::print("Average books rating in library: {}\n", avrRating);
 
     // Filters
-    auto filtered = filterBooks(db.begin(), db.end(), all_of(YearBetween(1900, 1999), RatingAbove(4.5)));
+    auto filtered = filterBooks(db.cbegin(), db.cend(), all_of(YearBetween(1900, 1999), RatingAbove(4.5)));
     std::print("\n\nBooks from the 20th century with rating ≥ 4.5:\n");
     std::for_each(filtered.cbegin(), filtered.cend(), [](const auto &v) { std::print("{}\n", v.get()); });
 
@@ -61,8 +61,8 @@ int main() {
     std::print("\n\nTop 3 books by rating:\n");
     std::for_each(topBooks.cbegin(), topBooks.cend(), [](const auto &v) { std::print("{}\n", v.get()); });
 
-    auto orwellBookIt = std::find_if(db.begin(), db.end(), [](const auto &v) { return v.author == "George Orwell"; });
-    if (orwellBookIt != db.end()) {
+    auto orwellBookIt = std::find_if(db.cbegin(), db.cend(), [](const auto &v) { return v.author == "George Orwell"; });
+    if (orwellBookIt != db.cend()) {
         std::print("\n\nTransparent lookup by authors. Found Orwell's book: {}\n", *orwellBookIt);
     }
 
@@ -3,6 +3,17 @@
 #include "filters.hpp"
 #include "comparators.hpp"
 #include "statsistics.hpp"
+#include "journal.hpp"
+#include "recovery.hpp"
+#include "read_counter.hpp"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <filesystem>
+#include <limits>
+#include <fstream>
+#include <thread>
 
 #include <gtest/gtest.h>
 #include "book_database.hpp"
@@ -150,3 +161,515 @@ TEST(Statistics, GenreRatingsAndAuthorHistogram) {
     EXPECT_NE(hist.find("George Orwell:"), std::string::npos);
     EXPECT_NE(hist.find("J.R.R. Tolkien:"), std::string::npos);
 }
+
+class JournalTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        dir_ = std::filesystem::temp_directory_path() /
+               std::format("bookdb_{}_{}", ::getpid(), ::testing::UnitTest::GetInstance()->current_test_info()->name());
+        std::filesystem::remove_all(dir_);
+        std::filesystem::create_directories(dir_);
+    }
+
+    void TearDown() override { std::filesystem::remove_all(dir_); }
+
+    std::filesystem::path dir_;
+};
+
+TEST_F(JournalTest, ReplayRestoresInsertsAndClear) {
+    auto log = dir_ / "db.journal";
+    {
+        Journal journal{log};
+        BookDatabase<> db;
+        db.AttachJournal(journal);
+        db.EmplaceBack("Dune", "Frank Herbert", 1965, Genre::SciFi, 4.6, 50);
+        db.Clear();
+        db.EmplaceBack("1984", "George Orwell", 1949, Genre::SciFi, 4., 190);
+        db.PushBack(Book{"Animal Farm", "George Orwell", 1945, Genre::Fiction, 4.4, 143});
+    }
+
+    BookDatabase<> restored;
+    Recover(restored, log);
+
+    ASSERT_EQ(restored.size(), 2u);
+    EXPECT_EQ(restored.GetAuthors().size(), 1u);
+    EXPECT_EQ(restored.GetBooks()[0].title, "1984");
+    EXPECT_EQ(restored.GetBooks()[1].title, "Animal Farm");
+    EXPECT_EQ(restored.GetBooks()[1].genre, Genre::Fiction);
+    EXPECT_DOUBLE_EQ(restored.GetBooks()[1].rating, 4.4);
+    EXPECT_EQ(restored.GetBooks()[1].read_count, 143);
+    EXPECT_EQ(restored.GetBooks()[1].author, *restored.GetAuthors().begin());
+}
+
+TEST_F(JournalTest, GroupCommitBuffersUntilThreshold) {
+    auto log = dir_ / "db.journal";
+    Journal journal{log, {.group_commit_bytes = 1 << 20, .group_commit_interval = std::chrono::hours{1}}};
+    BookDatabase<> db;
+    db.AttachJournal(journal);
+
+    db.EmplaceBack("Dune", "Frank Herbert", 1965, Genre::SciFi, 4.6, 50);
+    EXPECT_GT(journal.PendingBytes(), 0u);
+    EXPECT_EQ(std::filesystem::file_size(log), 0u);
+
+    journal.Sync();
+    EXPECT_EQ(journal.PendingBytes(), 0u);
+    EXPECT_GT(std::filesystem::file_size(log), 0u);
+}
+
+TEST_F(JournalTest, TornTailIsDroppedAndTruncated) {
+    auto log = dir_ / "db.journal";
+    {
+        Journal journal{log};
+        BookDatabase<> db;
+        db.AttachJournal(journal);
+        db.EmplaceBack("Dune", "Frank Herbert", 1965, Genre::SciFi, 4.6, 50);
+        db.EmplaceBack("Emma", "Jane Austen", 1815, Genre::Fiction, 4.1, 30);
+    }
+    auto full = std::filesystem::file_size(log);
+    std::filesystem::resize_file(log, full - 3);
+
+    BookDatabase<> restored;
+    Recover(restored, log);
+
+    ASSERT_EQ(restored.size(), 1u);
+    EXPECT_EQ(restored.GetBooks()[0].title, "Dune");
+    EXPECT_LT(std::filesystem::file_size(log), full - 3);
+}
+
+TEST_F(JournalTest, CheckpointThenReplayOnTopOfSnapshot) {
+    auto log = dir_ / "db.journal";
+    auto snapshot = dir_ / "db.snapshot";
+    {
+        Journal journal{log};
+        auto db = makeDB();
+        db.AttachJournal(journal);
+        Checkpoint(db, journal, snapshot);
+        EXPECT_EQ(journal.GetEpoch(), 1u);
+        EXPECT_EQ(JournalEpoch(ReadJournalFile(log)), 1u);
+
+        db.EmplaceBack("Dune", "Frank Herbert", 1965, Genre::SciFi, 4.6, 50);
+    }
+
+    BookDatabase<> restored;
+    Recover(restored, log, snapshot);
+
+    ASSERT_EQ(restored.size(), makeDB().size() + 1);
+    EXPECT_EQ(restored.GetBooks().back().title, "Dune");
+}
+
+TEST_F(JournalTest, CrashBetweenSnapshotAndResetDoesNotDuplicate) {
+    auto log = dir_ / "db.journal";
+    auto snapshot = dir_ / "db.snapshot";
+    {
+        Journal journal{log};
+        auto db = makeDB();
+        db.AttachJournal(journal);
+        db.EmplaceBack("Dune", "Frank Herbert", 1965, Genre::SciFi, 4.6, 50);
+
+        // Checkpoint, прерванный после rename снапшота, но до Reset() журнала
+        journal.Sync();
+        SaveSnapshot(db, snapshot, journal.GetEpoch() + 1);
+    }
+
+    BookDatabase<> restored;
+    Recover(restored, log, snapshot);
+    EXPECT_EQ(restored.size(), makeDB().size() + 1);
+
+    // Журнал переведён в поколение снапшота, и новые записи снова восстанавливаются
+    {
+        Journal journal{log};
+        EXPECT_EQ(journal.GetEpoch(), 1u);
+        restored.AttachJournal(journal);
+        restored.EmplaceBack("Emma", "Jane Austen", 1815, Genre::Fiction, 4.1, 30);
+    }
+
+    BookDatabase<> again;
+    Recover(again, log, snapshot);
+    ASSERT_EQ(again.size(), makeDB().size() + 2);
+    EXPECT_EQ(again.GetBooks().back().title, "Emma");
+}
+
+TEST_F(JournalTest, JournalWithoutMatchingSnapshotIsRejected) {
+    auto log = dir_ / "db.journal";
+    auto snapshot = dir_ / "db.snapshot";
+    {
+        Journal journal{log};
+        auto db = makeDB();
+        db.AttachJournal(journal);
+        Checkpoint(db, journal, snapshot);
+    }
+
+    BookDatabase<> restored;
+    EXPECT_THROW(Recover(restored, log), std::runtime_error);
+
+    // Снапшот без поколения новее журнального задвоил бы все книги журнала
+    SaveSnapshot(makeDB(), snapshot, 0);
+    BookDatabase<> doubled;
+    EXPECT_THROW(Recover(doubled, log, snapshot), std::runtime_error);
+}
+
+TEST_F(JournalTest, IdleTailIsSyncedByBackgroundFlusher) {
+    auto log = dir_ / "db.journal";
+    Journal journal{log, {.group_commit_bytes = 1 << 20, .group_commit_interval = std::chrono::milliseconds{5}}};
+    BookDatabase<> db;
+    db.AttachJournal(journal);
+
+    db.EmplaceBack("Dune", "Frank Herbert", 1965, Genre::SciFi, 4.6, 50);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+    while (journal.PendingBytes() != 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+
+    EXPECT_EQ(journal.PendingBytes(), 0u);
+    EXPECT_GT(std::filesystem::file_size(log), 0u);
+}
+
+TEST_F(JournalTest, RolledBackRecordIsNeverWritten) {
+    auto log = dir_ / "db.journal";
+    {
+        Journal journal{log};
+        journal.AppendInsert(Book{"Dune", "Frank Herbert"});
+        journal.Rollback();
+        journal.AppendInsert(Book{"Emma", "Jane Austen"});
+        journal.Commit();
+    }
+
+    BookDatabase<> restored;
+    Recover(restored, log);
+    ASSERT_EQ(restored.size(), 1u);
+    EXPECT_EQ(restored.GetBooks()[0].title, "Emma");
+}
+
+TEST_F(JournalTest, CopyIsNotJournaledAndMoveTakesJournal) {
+    auto log = dir_ / "db.journal";
+    {
+        Journal journal{log};
+        BookDatabase<> db;
+        db.AttachJournal(journal);
+        db.EmplaceBack("Dune", "Frank Herbert", 1965, Genre::SciFi, 4.6, 50);
+
+        auto copy = db;
+        EXPECT_EQ(copy.GetJournal(), nullptr);
+        copy.EmplaceBack("Emma", "Jane Austen", 1815, Genre::Fiction, 4.1, 30);
+
+        auto moved = std::move(db);
+        EXPECT_EQ(moved.GetJournal(), &journal);
+        EXPECT_EQ(db.GetJournal(), nullptr);
+        moved.EmplaceBack("1984", "George Orwell", 1949, Genre::SciFi, 4., 190);
+    }
+
+    BookDatabase<> restored;
+    Recover(restored, log);
+    ASSERT_EQ(restored.size(), 2u);
+    EXPECT_EQ(restored.GetBooks()[0].title, "Dune");
+    EXPECT_EQ(restored.GetBooks()[1].title, "1984");
+}
+
+TEST_F(JournalTest, MalformedRecordThrowsAndLeavesDatabaseUntouched) {
+    auto log = dir_ / "db.journal";
+    std::string data;
+    AppendJournalRecord(data, JournalOp::Insert, [](std::string& out) { EncodeBook(out, Book{"Dune", "Frank Herbert"}); });
+    AppendJournalRecord(data, JournalOp::Insert, [](std::string& out) { out += "junk"; });
+    {
+        std::ofstream out{log, std::ios::binary};
+        out << data;
+    }
+
+    BookDatabase<> restored;
+    restored.EmplaceBack("Emma", "Jane Austen", 1815, Genre::Fiction, 4.1, 30);
+    EXPECT_THROW(Recover(restored, log), std::runtime_error);
+    EXPECT_EQ(std::filesystem::file_size(log), data.size());
+
+    // Первая запись журнала корректна, но в базу она не попала
+    ASSERT_EQ(restored.size(), 1u);
+    EXPECT_EQ(restored.GetBooks()[0].title, "Emma");
+    EXPECT_EQ(restored.GetAuthors().size(), 1u);
+}
+
+TEST(QueryCache, RepeatedQueriesHitUntilMutation) {
+    auto db = makeDB();
+    db.EnableQueryCache();
+    const auto& cdb = db;
+
+    auto query = all_of(YearBetween(1900, 1999), RatingAbove(4.5));
+    auto first = cdb.FindRows(query);
+    auto second = cdb.FindRows(all_of(YearBetween(1900, 1999), RatingAbove(4.5)));
+
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(cdb.GetQueryCacheStats().hits, 1u);
+    EXPECT_EQ(cdb.GetQueryCacheStats().misses, 1u);
+
+    auto expected = filterBooks(cdb.GetBooks().begin(), cdb.GetBooks().end(), query);
+    ASSERT_EQ(first->size(), expected.size());
+    for (std::size_t i = 0; i < expected.size(); ++i)
+        EXPECT_EQ(&cdb.GetBooks()[(*first)[i]], &expected[i].get());
+
+    db.EmplaceBack("Dune", "Frank Herbert", 1965, Genre::SciFi, 4.6, 50);
+    auto third = cdb.FindRows(query);
+    EXPECT_NE(first, third);
+    EXPECT_EQ(third->size(), first->size() + 1);
+    EXPECT_EQ(cdb.GetQueryCacheStats().misses, 2u);
+}
+
+TEST(QueryCache, TopNRowsDoesNotReorderAndIsCached) {
+    auto db = makeDB();
+    db.EnableQueryCache();
+    const auto& cdb = db;
+
+    auto top = cdb.TopNRows(3, comp::MoreByRating{});
+    ASSERT_EQ(top->size(), 3u);
+    EXPECT_EQ(cdb.GetBooks()[(*top)[0]].title, "The Hobbit");
+    EXPECT_EQ(cdb.GetBooks()[(*top)[1]].title, "To Kill a Mockingbird");
+    EXPECT_EQ(cdb.GetBooks()[(*top)[2]].title, "Pride and Prejudice");
+
+    EXPECT_EQ(cdb.TopNRows(3, comp::MoreByRating{}), top);
+    EXPECT_NE(cdb.TopNRows(2, comp::MoreByRating{}), top);
+    EXPECT_EQ(cdb.GetQueryCacheStats().hits, 1u);
+
+    std::sort(db.begin(), db.end(), comp::LessByTitle{});
+    EXPECT_NE(cdb.TopNRows(3, comp::MoreByRating{}), top);
+}
+
+TEST(QueryCache, LruEvictionAndUncacheablePredicates) {
+    auto db = makeDB();
+    db.EnableQueryCache(2);
+    const auto& cdb = db;
+
+    cdb.FindRows(GenreIs(Genre::Fiction));
+    cdb.FindRows(GenreIs(Genre::SciFi));
+    cdb.FindRows(GenreIs(Genre::Fiction));
+    cdb.FindRows(GenreIs(Genre::Mystery));  // вытесняет SciFi
+    cdb.FindRows(GenreIs(Genre::Fiction));
+    cdb.FindRows(GenreIs(Genre::SciFi));
+
+    EXPECT_EQ(cdb.GetQueryCacheStats().hits, 2u);
+    EXPECT_EQ(cdb.GetQueryCacheStats().misses, 4u);
+
+    auto rows = cdb.FindRows([](const Book& b) { return b.author == "George Orwell"; });
+    EXPECT_EQ(rows->size(), 2u);
+    EXPECT_EQ(cdb.GetQueryCacheStats().misses, 4u);
+}
+
+TEST(ReadTracking, ConcurrentRecordReadIsFoldedIntoReadCount) {
+    auto db = makeDB();
+    const auto& cdb = db;
+    const auto first = cdb.GetBooks()[0];
+    const auto last = cdb.GetBooks()[9];
+
+    constexpr int kThreads = 8;
+    constexpr int kReads = 10000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&db, a = first.id, b = last.id] {
+            for (int i = 0; i < kReads; ++i) {
+                db.RecordRead(a);
+                db.RecordRead(b);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    EXPECT_EQ(cdb.GetBooks()[0].read_count, first.read_count);
+    EXPECT_EQ(db.PendingReads(), 2u * kThreads * kReads);
+    EXPECT_EQ(db.FlushReads(), 2u * kThreads * kReads);
+    EXPECT_EQ(cdb.GetBooks()[0].read_count, first.read_count + kThreads * kReads);
+    EXPECT_EQ(cdb.GetBooks()[9].read_count, last.read_count + kThreads * kReads);
+    EXPECT_EQ(db.FlushReads(), 0u);
+}
+
+TEST(ReadTracking, IdsSurviveConcurrentReorder) {
+    auto db = makeDB();
+    const auto& cdb = db;
+    auto it = std::find_if(cdb.begin(), cdb.end(), [](const Book& b) { return b.title == "Lord of the Flies"; });
+    const BookId id = it->id;
+    const auto before = it->read_count;
+
+    constexpr int kReads = 20000;
+    std::thread reader{[&db, id] {
+        for (int i = 0; i < kReads; ++i) db.RecordRead(id);
+    }};
+    for (int i = 0; i < 50; ++i) {
+        if (i % 2)
+            std::sort(db.begin(), db.end(), comp::LessByTitle{});
+        else
+            std::sort(db.begin(), db.end(), comp::MoreByRating{});
+        db.FlushReads();
+    }
+    reader.join();
+    db.FlushReads();
+
+    it = std::find_if(cdb.begin(), cdb.end(), [](const Book& b) { return b.title == "Lord of the Flies"; });
+    EXPECT_EQ(it->read_count, before + kReads);
+
+    // Невыданные id отвергаются, даже если попадают в уже выделенный сегмент
+    EXPECT_FALSE(db.RecordRead(1'000'000));
+    EXPECT_FALSE(db.RecordRead(500));
+    EXPECT_FALSE(db.RecordRead(cdb.size()));
+    EXPECT_EQ(db.PendingReads(), 0u);
+}
+
+TEST(ReadTracking, ClearReusesIdSpaceAndRejectsStaleIds) {
+    BookDatabase<> db;
+    const auto& cdb = db;
+    constexpr std::size_t kBooks = ReadCounter::kSegmentSize * 2 + 5;
+
+    std::vector<BookId> stale;
+    for (int round = 0; round < 4; ++round) {
+        for (std::size_t i = 0; i < kBooks; ++i) db.EmplaceBack(std::format("Book {}", i), "Author");
+        EXPECT_EQ(ReadCounter::IndexOf(cdb.GetBooks().front().id), 0u);
+        EXPECT_EQ(ReadCounter::IndexOf(cdb.GetBooks().back().id), kBooks - 1);
+
+        for (BookId id : stale) EXPECT_FALSE(db.RecordRead(id));
+        EXPECT_TRUE(db.RecordRead(cdb.GetBooks().back().id, 3));
+        EXPECT_EQ(db.FlushReads(), 3u);
+        EXPECT_EQ(cdb.GetBooks().back().read_count, 3);
+        EXPECT_EQ(cdb.GetBooks().front().read_count, 0);
+
+        stale = {cdb.GetBooks().front().id, cdb.GetBooks().back().id};
+        db.Clear();
+        EXPECT_EQ(db.PendingReads(), 0u);
+    }
+}
+
+TEST(ReadTracking, ReadsRacingClearNeverReachNewBooks) {
+    auto db = makeDB();
+    const auto& cdb = db;
+    std::vector<BookId> old_ids;
+    for (const auto& b : cdb) old_ids.push_back(b.id);
+
+    std::atomic<bool> done{false};
+    std::thread reader{[&] {
+        while (!done.load()) {
+            for (BookId id : old_ids) db.RecordRead(id);
+        }
+    }};
+    for (int round = 0; round < 200; ++round) {
+        db.Clear();
+        for (int i = 0; i < 10; ++i) db.EmplaceBack(std::format("Book {}", i), "Author");
+    }
+    done = true;
+    reader.join();
+
+    db.FlushReads();
+    for (const auto& b : cdb) EXPECT_EQ(b.read_count, 0);
+}
+
+TEST(ReadTracking, MovedFromDatabaseIsReusable) {
+    auto a = makeDB();
+    const auto& ca = a;
+    a.RecordRead(ca.GetBooks()[0].id, 7);
+
+    auto b = std::move(a);
+    EXPECT_EQ(b.PendingReads(), 7u);
+    b.FlushReads();
+    EXPECT_EQ(b.GetBooks()[0].read_count, makeDB().GetBooks()[0].read_count + 7);
+
+    a.PushBack(Book{"Dune", "Frank Herbert", 1965, Genre::SciFi, 4.6, 50});
+    ASSERT_EQ(ca.size(), 1u);
+    EXPECT_TRUE(a.RecordRead(ca.GetBooks()[0].id, 2));
+    EXPECT_EQ(a.FlushReads(), 2u);
+    EXPECT_EQ(ca.GetBooks()[0].read_count, 52);
+}
+
+TEST(ReadTracking, SortSeesPendingReadsAndClearDropsThem) {
+    auto db = makeDB();
+    db.RecordRead(db.GetBooks()[9].id, 1000);  // Lord of the Flies
+
+    std::sort(db.begin(), db.end(), comp::LessByPopularity{});
+    EXPECT_EQ(db.GetBooks().back().title, "Lord of the Flies");
+    EXPECT_EQ(db.GetBooks().back().read_count, 1089);
+
+    auto stale = db.GetBooks()[0].id;
+    db.RecordRead(stale, 5);
+    db.Clear();
+    db.RecordRead(stale, 5);
+    db.EmplaceBack("Dune", "Frank Herbert", 1965, Genre::SciFi, 4.6, 50);
+    EXPECT_EQ(db.FlushReads(), 0u);
+    EXPECT_EQ(db.GetBooks()[0].read_count, 50);
+}
+
+TEST(ReadTracking, FoldPolicyAndSaturation) {
+    BookDatabase<> db;
+    auto& b = db.EmplaceBack("Dune", "Frank Herbert", 1965, Genre::SciFi, 4.6,
+                             std::numeric_limits<std::int64_t>::max() - 10);
+    const BookId id = b.id;
+    db.SetReadFoldPolicy({.max_pending_reads = 10, .max_delay = std::chrono::hours{1}});
+
+    db.RecordRead(id, 5);
+    EXPECT_FALSE(db.FlushReadsIfDue());
+    db.RecordRead(id, 5);
+    EXPECT_TRUE(db.FlushReadsIfDue());
+    EXPECT_EQ(db.GetBooks()[0].read_count, std::numeric_limits<std::int64_t>::max());
+
+    db.RecordRead(id, 100);
+    db.FlushReads();
+    EXPECT_EQ(db.GetBooks()[0].read_count, std::numeric_limits<std::int64_t>::max());
+}
+
+TEST(QueryCache, RetainedMutableReferenceRequiresMarkModified) {
+    auto db = makeDB();
+    db.EnableQueryCache();
+    const auto& cdb = db;
+
+    auto& books = db.GetBooks();
+    auto high = RatingAbove(4.5);
+    auto before = cdb.FindRows(high);
+
+    // Изменение через сохранённую ссылку база не видит, пока о нём не сообщат
+    auto row = (*before)[0];
+    books[row].rating = 0.0;
+    EXPECT_EQ(cdb.FindRows(high), before);
+
+    db.MarkModified();
+    auto after = cdb.FindRows(high);
+    EXPECT_NE(after, before);
+    EXPECT_EQ(after->size(), before->size() - 1);
+}
+
+TEST(QueryCache, ConstReadsDoNotInvalidateAndAreThreadSafe) {
+    auto db = makeDB();
+    db.EnableQueryCache(4);
+    const auto& cdb = db;
+
+    auto generation = cdb.GetGeneration();
+    auto found = std::find_if(db.cbegin(), db.cend(), [](const Book& b) { return b.author == "George Orwell"; });
+    EXPECT_NE(found, db.cend());
+    for (const auto& b : cdb) (void)b;
+    EXPECT_EQ(cdb.GetGeneration(), generation);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&cdb, t] {
+            for (int i = 0; i < 1000; ++i) {
+                auto rows = cdb.FindRows(GenreIs(static_cast<Genre>((i + t) % 6)));
+                auto top = cdb.TopNRows(1 + i % 3, comp::MoreByRating{});
+                EXPECT_FALSE(top->empty());
+                (void)rows;
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    auto stats = cdb.GetQueryCacheStats();
+    EXPECT_EQ(stats.hits + stats.misses, 8000u);
+}
+
+TEST(QueryCache, ReadFoldInvalidatesOnlyReadCountQueries) {
+    auto db = makeDB();
+    db.EnableQueryCache();
+    const auto& cdb = db;
+
+    auto fiction = cdb.FindRows(GenreIs(Genre::Fiction));
+    auto least_read = cdb.TopNRows(1, comp::LessByPopularity{});
+    const auto generation = cdb.GetGeneration();
+
+    db.RecordRead(cdb.GetBooks()[(*least_read)[0]].id, 1'000'000);
+    EXPECT_EQ(db.FlushReads(), 1'000'000u);
+    EXPECT_EQ(cdb.GetGeneration(), generation);
+
+    EXPECT_EQ(cdb.FindRows(GenreIs(Genre::Fiction)), fiction);
+    auto after = cdb.TopNRows(1, comp::LessByPopularity{});
+    EXPECT_NE((*after)[0], (*least_read)[0]);
+    EXPECT_EQ(cdb.GetQueryCacheStats().hits, 1u);
+    EXPECT_EQ(cdb.GetQueryCacheStats().misses, 3u);
+}